@@ -2,38 +2,19 @@
 #include <string>
 #include <array>
 #include <asio.hpp>
+#include "parse_port.hpp"
+#include "happy_eyeballs.hpp"
 
-int parse_port(const char* param) noexcept {
-    int result = 0;
-
-    while (*param) {
-        if (result > 65535) {
-            return -1;
-        }
-
-        if (isdigit(*param)) {
-            result = 10 * result + (*param - '0');
-        }
-        else {
-            return -1;
-        }
-
-        ++param;
-    }
+void echo(const std::string& host, int port, const std::string& message) {
+    asio::error_code ec;
+    asio::io_context ioc{};
 
-    if (result > 65535) {
-        return -1;
+    asio::ip::tcp::socket s = connect_happy_eyeballs(ioc, host, port, ec);
+    if (ec) {
+        std::cerr << "connect failed, " << ec.value() << ", " << ec.message() << "\n";
+        return;
     }
 
-    return result;
-}
-
-void echo(const std::string& ip, int port, const std::string& message) {
-    asio::io_context ioc{};
-    asio::ip::tcp::socket s{ ioc };
-    asio::ip::tcp::endpoint ep{ asio::ip::make_address(ip), (asio::ip::port_type)port };
-
-    s.connect(ep);
     asio::write(s, asio::buffer(message));
 
     std::array<char, 256> buf{};
@@ -44,7 +25,7 @@ void echo(const std::string& ip, int port, const std::string& message) {
 // g++ asio_echo_client.cpp -I asio/include -l ws2_32 -o client
 int main(int argc, char* argv[]) {
     if (argc != 3) {
-        std::cerr << "echo client usage: " << argv[0] << " <ip> <port>\n";
+        std::cerr << "echo client usage: " << argv[0] << " <host> <port>\n";
         return 1;
     }
 
@@ -1,95 +1,393 @@
 #include <iostream>
 #include <utility>
 #include <array>
+#include <memory>
+#include <string>
+#include <chrono>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
 #include <asio.hpp>
+#include "parse_port.hpp"
+#include "echo_metrics.hpp"
+#include "echo_common.hpp"
 
-int parse_port(const char* param) noexcept {
-    int result = 0;
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include "shm_ring.hpp"
+#endif
 
-    while (*param) {
-        if (result > 65535) {
-            return -1;
-        }
-
-        if (isdigit(*param)) {
-            result = 10 * result + (*param - '0');
-        }
-        else {
-            return -1;
-        }
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-        ++param;
+// serves both tcp and unix domain stream sockets.
+template<typename Protocol>
+class session : public std::enable_shared_from_this<session<Protocol>> {
+public:
+    session(typename Protocol::socket&& connection, buffer_pool& pool, const std::string& peer)
+        : connection_{ std::move(connection) }, pool_{ pool }, peer_{ peer } {
+        local_metrics().opened.add(1);
     }
 
-    if (result > 65535) {
-        return -1;
+    ~session() {
+        local_metrics().closed.add(1);
     }
 
-    return result;
-}
+    void wait_readable() {
+        auto self = this->shared_from_this();
 
-template<std::size_t N>
-void send_all(asio::ip::tcp::socket& connection, const std::array<char, N>& buf, std::size_t len) {
-    asio::error_code ec;
-    std::size_t bytes_written = 0;
+        connection_.async_wait(Protocol::socket::wait_read, [this, self](const asio::error_code& ec) {
+            if (ec) {
+                std::cerr << peer_ << " wait read failed, " << ec.value() << ", " << ec.message() << "\n";
+                local_metrics().errors.record(ec);
+                return;
+            }
+
+            handle_readable();
+        });
+    }
+
+private:
+    void handle_readable() {
+        asio::error_code ec;
 
-    while (bytes_written < len) {
-        std::size_t written = connection.write_some(asio::buffer(buf.data() + bytes_written, len - bytes_written), ec);
+        // the socket is readable, so read_some returns at once.
+        buf_ = pool_.acquire();
+        std::size_t len = connection_.read_some(asio::buffer(*buf_), ec);
+        thread_metrics& metrics = local_metrics();
 
         if (ec) {
-            std::cerr << "one connection send failed, " << ec.value() << ", " << ec.message() << "\n";
+            pool_.release(std::move(buf_));
+
+            // an orderly close is counted by echo_closed_connections_total, only real failures are errors.
+            if (ec == asio::error::eof) {
+                std::cerr << peer_ << " connection has been closed\n";
+            }
+            else {
+                std::cerr << peer_ << " read failed, " << ec.value() << ", " << ec.message() << "\n";
+                metrics.errors.record(ec);
+            }
+
+            connection_.shutdown(Protocol::socket::shutdown_both, ec);
+            connection_.close(ec);
             return;
         }
 
-        bytes_written += written;
+        const auto time_start = std::chrono::steady_clock::now();
+        metrics.bytes_in.add(len);
+        metrics.read_bytes.observe((double)len);
+
+        std::cout << peer_ << " " << len << ", ";
+        std::cout.write(buf_->data(), len) << "\n";
+
+        // the buffer stays borrowed until the echo has been written.
+        auto self = this->shared_from_this();
+        send_all(connection_, *buf_, len, [this, self, time_start](const asio::error_code& ec) {
+            pool_.release(std::move(buf_));
+
+            if (ec) {
+                asio::error_code close_ec;
+                connection_.close(close_ec);
+                return;
+            }
+
+            local_metrics().handler_seconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count());
+            wait_readable();
+        });
     }
-}
 
-void handle_connection(asio::ip::tcp::socket&& connection) {
+    typename Protocol::socket connection_;
+    buffer_pool& pool_;
+    std::unique_ptr<buffer_pool::buffer> buf_;
+    const std::string peer_;
+};
+
+void handle_connection(asio::ip::tcp::socket&& connection, buffer_pool& pool) {
     asio::error_code ec;
 
+    local_metrics().accepted.add(1);
+
     auto ep = connection.remote_endpoint(ec);
     if (ec) {
         std::cerr << "get remote endpoint failed, " << ec.value() << ", " << ec.message() << "\n";
+        local_metrics().errors.record(ec);
         return;
     }
 
-    const std::string ip = ep.address().to_string();
-    const auto port = ep.port();
+    const std::string peer = ep.address().to_string() + ":" + std::to_string(ep.port());
+    std::make_shared<session<asio::ip::tcp>>(std::move(connection), pool, peer)->wait_readable();
+}
 
-    std::array<char, 256> buf;
-    buf.fill('\0');
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+void handle_connection(asio::local::stream_protocol::socket&& connection, buffer_pool& pool) {
+    local_metrics().accepted.add(1);
 
-    std::size_t len = connection.read_some(asio::buffer(buf), ec);
-    
-    if (ec) {
-        if (ec == asio::error::eof) {
-            std::cerr << ip << ":" << port << " connection has been closed\n";
+    // unix domain clients are usually unnamed, so there is no peer address worth printing.
+    std::make_shared<session<asio::local::stream_protocol>>(std::move(connection), pool, "unix")->wait_readable();
+}
+#endif
+
+#ifdef __linux__
+// the client doesn't signal when it consumes a response, a full response ring is polled at this interval.
+const int SHM_RETRY_MILLISEC = 1;
+
+/*
+    shared memory transport for clients on the same host.
+    a client connects to the shm control socket and receives three descriptors over it:
+    a memfd holding the shm_channel, an eventfd it signals after pushing requests,
+    and an eventfd the server signals after pushing responses.
+    the control socket stays open for the lifetime of the channel, its eof ends the session.
+    asio_local_latency_bench.cpp is the client for this and for the unix socket transport.
+*/
+class shm_session : public std::enable_shared_from_this<shm_session> {
+public:
+    shm_session(asio::local::stream_protocol::socket&& control, shm_channel* channel, int request_event_fd, int response_event_fd)
+        : control_{ std::move(control) }, channel_{ channel },
+          request_event_{ control_.get_executor(), request_event_fd }, response_event_{ control_.get_executor(), response_event_fd },
+          retry_timer_{ control_.get_executor() } {
+        local_metrics().opened.add(1);
+    }
+
+    ~shm_session() {
+        ::munmap(channel_, sizeof(shm_channel));
+        local_metrics().closed.add(1);
+    }
+
+    void start() {
+        auto self = shared_from_this();
+
+        control_.async_wait(asio::local::stream_protocol::socket::wait_read, [this, self](const asio::error_code&) {
+            std::cerr << "shm connection has been closed\n";
+            close();
+        });
+
+        wait_requests();
+    }
+
+private:
+    void close() {
+        asio::error_code ec;
+        request_event_.close(ec);
+        control_.close(ec);
+        retry_timer_.cancel();
+    }
+
+    void retry_requests() {
+        if (retrying_) {
+            return;
         }
-        else {
-            std::cerr << ip << ":" << port << " read failed, " << ec.value() << ", " << ec.message() << "\n";
+
+        retrying_ = true;
+        auto self = shared_from_this();
+
+        retry_timer_.expires_after(std::chrono::milliseconds(SHM_RETRY_MILLISEC));
+        retry_timer_.async_wait([this, self](const asio::error_code& ec) {
+            retrying_ = false;
+
+            if (!ec && request_event_.is_open()) {
+                handle_requests();
+            }
+        });
+    }
+
+    void wait_requests() {
+        auto self = shared_from_this();
+
+        request_event_.async_read_some(asio::buffer(&event_count_, sizeof(event_count_)), [this, self](const asio::error_code& ec, std::size_t) {
+            if (ec) {
+                if (ec != asio::error::operation_aborted) {
+                    std::cerr << "shm wait request failed, " << ec.value() << ", " << ec.message() << "\n";
+                    local_metrics().errors.record(ec);
+                }
+
+                return;
+            }
+
+            handle_requests();
+            if (request_event_.is_open()) {
+                wait_requests();
+            }
+        });
+    }
+
+    // the request slot is echoed straight into the response ring, no receive buffer is involved.
+    // the ring lives in memory the client can write, so head, tail and len are all checked before use.
+    // when the response ring is full the remaining requests stay queued until the client catches up.
+    void handle_requests() {
+        bool responded = false;
+        bool blocked = false;
+        thread_metrics& metrics = local_metrics();
+
+        // head and tail are loaded once, whatever the client writes to them meanwhile is ignored until the next round.
+        // more than SHM_SLOT_COUNT pending only happens when the client has written garbage into them.
+        shm_ring& requests = channel_->requests;
+        const uint32_t head = requests.head.load(std::memory_order_relaxed);
+        const uint32_t pending = requests.tail.load(std::memory_order_acquire) - head;
+        if (pending > SHM_SLOT_COUNT) {
+            std::cerr << "shm request ring is corrupted, closing the connection\n";
+            metrics.errors.record(asio::error::invalid_argument);
+            close();
+            return;
         }
 
+        uint32_t consumed = 0;
+        for (; consumed < pending; ++consumed) {
+            const shm_slot& slot = requests.slots[(head + consumed) % SHM_SLOT_COUNT];
+
+            // read once, the client may rewrite it between the check and the copy.
+            const uint32_t len = *static_cast<const volatile uint32_t*>(&slot.len);
+            if (len > SHM_SLOT_SIZE) {
+                std::cerr << "shm request length " << len << " is invalid, one message dropped\n";
+                metrics.errors.record(asio::error::message_size);
+                continue;
+            }
+
+            const auto time_start = std::chrono::steady_clock::now();
+            if (!channel_->responses.push(slot.data, len)) {
+                blocked = true;
+                break;
+            }
+
+            std::cout << "shm " << len << ", ";
+            std::cout.write(slot.data, len) << "\n";
+
+            responded = true;
+            metrics.bytes_in.add(len);
+            metrics.read_bytes.observe((double)len);
+            metrics.bytes_out.add(len);
+            metrics.write_bytes.observe((double)len);
+            metrics.handler_seconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count());
+        }
+
+        requests.head.store(head + consumed, std::memory_order_release);
+
+        if (responded) {
+            asio::error_code ec;
+            const uint64_t one = 1;
+
+            asio::write(response_event_, asio::buffer(&one, sizeof(one)), ec);
+            if (ec) {
+                std::cerr << "shm notify failed, " << ec.value() << ", " << ec.message() << "\n";
+                metrics.errors.record(ec);
+            }
+        }
+
+        if (blocked) {
+            retry_requests();
+        }
+    }
+
+    asio::local::stream_protocol::socket control_;
+    shm_channel* channel_;
+    asio::posix::stream_descriptor request_event_;
+    asio::posix::stream_descriptor response_event_;
+    asio::steady_timer retry_timer_;
+    uint64_t event_count_ = 0;
+    bool retrying_ = false;
+};
+
+void handle_shm_connection(asio::local::stream_protocol::socket&& control) {
+    local_metrics().accepted.add(1);
+
+    const int memfd = ::memfd_create("asio_echo_shm", MFD_CLOEXEC);
+    if (memfd < 0) {
+        std::cerr << "memfd create failed, " << errno << ", " << std::strerror(errno) << "\n";
+        return;
+    }
+
+    if (::ftruncate(memfd, sizeof(shm_channel)) != 0) {
+        std::cerr << "memfd truncate failed, " << errno << ", " << std::strerror(errno) << "\n";
+        ::close(memfd);
         return;
     }
 
-    if (len == 0) {
+    void* addr = ::mmap(nullptr, sizeof(shm_channel), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (addr == MAP_FAILED) {
+        std::cerr << "memfd map failed, " << errno << ", " << std::strerror(errno) << "\n";
+        ::close(memfd);
         return;
     }
-    
-    std::cout << ip << ":" << port << " " << len << ", " << buf.data() << "\n";
-    send_all(connection, buf, len);
-    
-    connection.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-    connection.close();
+
+    // a fresh memfd is zero filled, which is the empty state of both rings.
+    shm_channel* channel = static_cast<shm_channel*>(addr);
+
+    const int request_event_fd = ::eventfd(0, EFD_CLOEXEC);
+    const int response_event_fd = ::eventfd(0, EFD_CLOEXEC);
+    const int fds[SHM_FD_COUNT] = { memfd, request_event_fd, response_event_fd };
+
+    const bool sent = request_event_fd >= 0 && response_event_fd >= 0 && send_fds(control.native_handle(), fds, SHM_FD_COUNT);
+    if (!sent) {
+        std::cerr << "shm descriptors send failed, " << errno << ", " << std::strerror(errno) << "\n";
+    }
+
+    // the mapping and the client's copies keep the memory alive.
+    ::close(memfd);
+
+    if (!sent) {
+        if (request_event_fd >= 0) ::close(request_event_fd);
+        if (response_event_fd >= 0) ::close(response_event_fd);
+        ::munmap(addr, sizeof(shm_channel));
+        return;
+    }
+
+    std::make_shared<shm_session>(std::move(control), channel, request_event_fd, response_event_fd)->start();
+}
+#endif
+
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+bool open_local_acceptor(asio::local::stream_protocol::acceptor& acc, const std::string& path) {
+    asio::error_code ec;
+    asio::local::stream_protocol::endpoint ep{ path };
+
+#ifndef _WIN32
+    // a socket file left over from an earlier run would make bind fail, anything else at the path is left alone.
+    struct stat st;
+    if (::stat(path.c_str(), &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            std::cerr << "local acceptor path " << path << " exists and is not a socket\n";
+            return false;
+        }
+
+        ::unlink(path.c_str());
+    }
+#endif
+
+    acc.open(ep.protocol(), ec);
+    if (ec) {
+        std::cerr << "local acceptor open failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    acc.bind(ep, ec);
+    if (ec) {
+        std::cerr << "local acceptor bind failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    acc.listen(asio::socket_base::max_listen_connections, ec);
+    if (ec) {
+        std::cerr << "local acceptor listen failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    return true;
 }
+#endif
 
-void start_echo_server(int port) {
+void start_echo_server(int port, const std::string& local_path, const std::string& shm_path, int metrics_port) {
     asio::error_code ec;
     asio::io_context ioc;
     asio::ip::tcp::endpoint ep{ asio::ip::tcp::v4(), (asio::ip::port_type)port };
     asio::ip::tcp::acceptor acc{ ioc };
 
+    // a handful of cached buffers covers the connections that are echoing at the same moment.
+    buffer_pool pool{ 64 };
+
     acc.open(ep.protocol(), ec);
     if (ec) {
         std::cerr << "acceptor open failed, " << ec.value() << ", " << ec.message() << "\n";
@@ -108,30 +406,64 @@ void start_echo_server(int port) {
         return;
     }
 
-    acc.listen(32, ec);
+    acc.listen(asio::socket_base::max_listen_connections, ec);
     if (ec) {
         std::cerr << "acceptor listen failed, " << ec.value() << ", " << ec.message() << "\n";
         return;
     }
 
-    while (true) {
-        asio::ip::tcp::socket client{ ioc };
-        acc.accept(client, ec);
+    accept_connections(acc, [&pool](asio::ip::tcp::socket&& client) {
+        handle_connection(std::move(client), pool);
+    });
 
-        if (ec) {
-            std::cerr << "acceptor accept failed, " << ec.value() << ", " << ec.message() << "\n";
+#if defined(ASIO_HAS_LOCAL_SOCKETS)
+    asio::local::stream_protocol::acceptor local_acc{ ioc };
+    if (!local_path.empty()) {
+        if (!open_local_acceptor(local_acc, local_path)) {
             return;
         }
-        else {
-            handle_connection(std::move(client));
+
+        accept_connections(local_acc, [&pool](asio::local::stream_protocol::socket&& client) {
+            handle_connection(std::move(client), pool);
+        });
+    }
+
+#ifdef __linux__
+    asio::local::stream_protocol::acceptor shm_acc{ ioc };
+    if (!shm_path.empty()) {
+        if (!open_local_acceptor(shm_acc, shm_path)) {
+            return;
         }
+
+        accept_connections(shm_acc, [](asio::local::stream_protocol::socket&& control) {
+            handle_shm_connection(std::move(control));
+        });
     }
+#endif
+#endif
+
+    asio::ip::tcp::acceptor metrics_acc{ ioc };
+    if (metrics_port > 0) {
+        if (!open_metrics_acceptor(metrics_acc, metrics_port)) {
+            return;
+        }
+
+        accept_connections(metrics_acc, [](asio::ip::tcp::socket&& client) {
+            std::make_shared<metrics_connection>(std::move(client), false)->start();
+        });
+    }
+
+    ioc.run();
 }
 
 // g++ asio_echo_server.cpp -I asio/include -l ws2_32 -o server
+//
+// the unix socket path, the shm control socket path (linux only) and the metrics port are optional,
+// "-" skips one, e.g. metrics on 127.0.0.1:9100 without local transports:
+// ./server 8080 - - 9100
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "echo server usage: " << argv[0] << " <port>\n";
+    if (argc < 2 || argc > 5) {
+        std::cerr << "echo server usage: " << argv[0] << " <port> [unix socket path] [shm control socket path] [metrics port]\n";
         return 1;
     }
 
@@ -141,6 +473,18 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    start_echo_server(port);
+    int metrics_port = 0;
+    if (argc > 4 && std::strcmp(argv[4], "-") != 0) {
+        metrics_port = parse_port(argv[4]);
+        if (metrics_port <= 0) {
+            std::cerr << "invalid metrics port\n";
+            return 1;
+        }
+    }
+
+    const std::string local_path = argc > 2 && std::strcmp(argv[2], "-") != 0 ? argv[2] : "";
+    const std::string shm_path = argc > 3 && std::strcmp(argv[3], "-") != 0 ? argv[3] : "";
+
+    start_echo_server(port, local_path, shm_path, metrics_port);
     return 0;
 }
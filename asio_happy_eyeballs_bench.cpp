@@ -0,0 +1,218 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <asio.hpp>
+#include "happy_eyeballs.hpp"
+
+using namespace std::chrono;
+
+// how long a filler connection may take before the listener counts as saturated.
+const int FILLER_WAIT_MILLISEC = 100;
+const int MAX_FILLERS = 64;
+
+struct race_result {
+    std::vector<double> samples_ms;
+    asio::error_code ec;
+    asio::ip::tcp::endpoint winner;
+};
+
+// accepts and drops every connection, the live endpoint in each race.
+void accept_and_close(asio::ip::tcp::acceptor& acc) {
+    acc.async_accept([&acc](const asio::error_code& ec, asio::ip::tcp::socket client) {
+        if (ec == asio::error::operation_aborted) {
+            return;
+        }
+
+        asio::error_code ignored;
+        client.close(ignored);
+        accept_and_close(acc);
+    });
+}
+
+bool open_listener(asio::ip::tcp::acceptor& acc, int backlog) {
+    asio::error_code ec;
+
+    acc.open(asio::ip::tcp::v4(), ec);
+    if (!ec) {
+        acc.bind(asio::ip::tcp::endpoint{ asio::ip::address_v4::loopback(), 0 }, ec);
+    }
+
+    if (!ec) {
+        acc.listen(backlog, ec);
+    }
+
+    if (ec) {
+        std::cerr << "listener open failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+// a listener whose accept queue is full drops new syns, connecting to it hangs like an unreachable host.
+// the fillers are connected until one of them stops completing, they must stay open during the races.
+bool open_blackhole(asio::io_context& ioc, asio::ip::tcp::acceptor& acc, std::vector<std::unique_ptr<asio::ip::tcp::socket>>& fillers) {
+    if (!open_listener(acc, 0)) {
+        return false;
+    }
+
+    for (int i = 0; i < MAX_FILLERS; ++i) {
+        std::unique_ptr<asio::ip::tcp::socket> s{ new asio::ip::tcp::socket{ ioc } };
+        bool connected = false;
+
+        s->async_connect(acc.local_endpoint(), [&connected](const asio::error_code& ec) {
+            connected = !ec;
+        });
+
+        ioc.run_for(milliseconds(FILLER_WAIT_MILLISEC));
+
+        if (!connected) {
+            asio::error_code ec;
+            s->close(ec);
+            ioc.restart();
+            ioc.run();
+            ioc.restart();
+            return true;
+        }
+
+        ioc.restart();
+        fillers.emplace_back(std::move(s));
+    }
+
+    std::cerr << "listener still accepts after " << MAX_FILLERS << " connections, no blackhole available\n";
+    return false;
+}
+
+// a port that was just bound and released, nothing listens on it so connecting is refused at once.
+asio::ip::tcp::endpoint refused_endpoint(asio::io_context& ioc) {
+    asio::ip::tcp::acceptor acc{ ioc };
+    if (!open_listener(acc, 1)) {
+        return asio::ip::tcp::endpoint{};
+    }
+
+    asio::ip::tcp::endpoint ep = acc.local_endpoint();
+    acc.close();
+    return ep;
+}
+
+race_result race(asio::io_context& ioc, const std::vector<asio::ip::tcp::endpoint>& endpoints, int iterations) {
+    race_result result;
+
+    for (int i = 0; i < iterations; ++i) {
+        asio::ip::tcp::socket s{ ioc };
+        asio::error_code ec;
+
+        auto time_start = steady_clock::now();
+
+        std::make_shared<happy_eyeballs_connector>(ioc, "localhost", 0,
+            [&s, &ec](const asio::error_code& connect_ec, asio::ip::tcp::socket&& connection) {
+                ec = connect_ec;
+                s = std::move(connection);
+            })->start(endpoints);
+
+        ioc.run();
+        ioc.restart();
+
+        auto time_end = steady_clock::now();
+
+        result.samples_ms.push_back(duration_cast<microseconds>(time_end - time_start).count() / 1000.0);
+        result.ec = ec;
+
+        if (!ec) {
+            result.winner = s.remote_endpoint(ec);
+        }
+    }
+
+    return result;
+}
+
+void print_race(const std::string& name, race_result& result) {
+    std::sort(result.samples_ms.begin(), result.samples_ms.end());
+
+    double total = 0;
+    for (double v : result.samples_ms) {
+        total += v;
+    }
+
+    std::cout << name << ": ";
+    std::cout << "avg=" << total / result.samples_ms.size() << "ms ";
+    std::cout << "p50=" << result.samples_ms[result.samples_ms.size() / 2] << "ms ";
+    std::cout << "max=" << result.samples_ms.back() << "ms, ";
+
+    if (result.ec) {
+        std::cout << "failed with " << result.ec.value() << ", " << result.ec.message() << "\n";
+    }
+    else {
+        std::cout << "connected to " << result.winner << "\n";
+    }
+}
+
+/*
+    measures how long the happy eyeballs connector takes to reach a live listener when the
+    endpoints ahead of it are dead, everything runs on loopback so no network is needed.
+
+    blackhole first: the first endpoint never answers, the live one is tried after the
+                     connection attempt delay, so expect about CONNECTION_ATTEMPT_DELAY_MILLISEC.
+    refused first:   the first endpoint is refused, the next attempt starts right away.
+    all refused:     every endpoint is refused, the time until the error is reported.
+
+    linux only, the blackhole relies on linux dropping syns once the accept queue is full.
+*/
+// g++ asio_happy_eyeballs_bench.cpp -DASIO_STANDALONE -I asio/include -lpthread -std=c++11 -o happy_eyeballs_bench
+int main(int argc, char* argv[]) {
+    if (argc != 1 && argc != 2) {
+        std::cerr << "happy eyeballs bench usage: " << argv[0] << " [iterations]\n";
+        return 1;
+    }
+
+    int iterations = argc == 2 ? std::atoi(argv[1]) : 10;
+    if (iterations <= 0) {
+        std::cerr << "invalid iterations\n";
+        return 1;
+    }
+
+    asio::io_context ioc;
+
+    // the live listener accepts on its own thread, so a race's ioc.run() only waits for the connector.
+    asio::io_context server_ioc;
+    asio::ip::tcp::acceptor live_acc{ server_ioc };
+    if (!open_listener(live_acc, asio::socket_base::max_listen_connections)) {
+        return 1;
+    }
+
+    accept_and_close(live_acc);
+    std::thread server_thread([&server_ioc]() {
+        server_ioc.run();
+    });
+
+    asio::ip::tcp::acceptor blackhole_acc{ ioc };
+    std::vector<std::unique_ptr<asio::ip::tcp::socket>> fillers;
+    const bool has_blackhole = open_blackhole(ioc, blackhole_acc, fillers);
+
+    const asio::ip::tcp::endpoint live = live_acc.local_endpoint();
+    const asio::ip::tcp::endpoint refused = refused_endpoint(ioc);
+    const asio::ip::tcp::endpoint other_refused = refused_endpoint(ioc);
+
+    race_result direct = race(ioc, { live }, iterations);
+    print_race("live only", direct);
+
+    if (has_blackhole) {
+        race_result blackhole = race(ioc, { blackhole_acc.local_endpoint(), live }, iterations);
+        print_race("blackhole first", blackhole);
+    }
+
+    race_result refused_first = race(ioc, { refused, live }, iterations);
+    print_race("refused first", refused_first);
+
+    race_result all_refused = race(ioc, { refused, other_refused }, iterations);
+    print_race("all refused", all_refused);
+
+    server_ioc.stop();
+    server_thread.join();
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+#include "parse_port.hpp"
+
+// reads VmRSS of the given process in kilobytes, -1 on failure.
+long read_rss_kb(const std::string& pid) {
+    std::ifstream status{ "/proc/" + pid + "/status" };
+    std::string line;
+
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmRSS:") == 0) {
+            std::istringstream iss{ line.substr(6) };
+            long kb = -1;
+            iss >> kb;
+            return kb;
+        }
+    }
+
+    return -1;
+}
+
+asio::ssl::context create_ssl_context() {
+    asio::ssl::context ctx{ asio::ssl::context::tls_client };
+
+    ctx.set_options(
+        asio::ssl::context::default_workarounds |
+        asio::ssl::context::no_sslv2 |
+        asio::ssl::context::no_sslv3 |
+        asio::ssl::context::no_tlsv1 |
+        asio::ssl::context::no_tlsv1_1 |
+        asio::ssl::context::single_dh_use
+    );
+
+    ctx.load_verify_file("server.crt");
+    ctx.set_verify_mode(asio::ssl::verify_peer);
+
+    return ctx;
+}
+
+// opens the connections and leaves them idle, the caller keeps them alive while measuring.
+bool open_idle_connections(asio::io_context& ioc, const asio::ip::tcp::endpoint& ep, int count,
+    std::vector<std::unique_ptr<asio::ip::tcp::socket>>& tcp_connections) {
+    asio::error_code ec;
+
+    for (int i = 0; i < count; ++i) {
+        std::unique_ptr<asio::ip::tcp::socket> s{ new asio::ip::tcp::socket{ ioc } };
+
+        s->connect(ep, ec);
+        if (ec) {
+            std::cerr << "connection " << i << " failed, " << ec.value() << ", " << ec.message() << "\n";
+            return false;
+        }
+
+        tcp_connections.emplace_back(std::move(s));
+    }
+
+    return true;
+}
+
+bool open_idle_ssl_connections(asio::io_context& ioc, asio::ssl::context& sslCtx, const asio::ip::tcp::endpoint& ep, int count,
+    std::vector<std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>>& ssl_connections) {
+    asio::error_code ec;
+
+    for (int i = 0; i < count; ++i) {
+        std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>> s{ new asio::ssl::stream<asio::ip::tcp::socket>{ ioc, sslCtx } };
+
+        s->next_layer().connect(ep, ec);
+        if (ec) {
+            std::cerr << "connection " << i << " failed, " << ec.value() << ", " << ec.message() << "\n";
+            return false;
+        }
+
+        s->handshake(asio::ssl::stream_base::client, ec);
+        if (ec) {
+            std::cerr << "connection " << i << " ssl hand shake failed, " << ec.value() << ", " << ec.message() << "\n";
+            return false;
+        }
+
+        ssl_connections.emplace_back(std::move(s));
+    }
+
+    return true;
+}
+
+/*
+    measures the resident memory an echo server spends on each idle connection.
+    start asio_echo_server or ssl_asio_echo_server first, then pass its pid here,
+    the server's VmRSS is sampled before and after the idle connections are opened.
+
+    with 500 connections on loopback a tcp connection costs about 1.4KB and a tls one about 72KB.
+    SSL_MODE_RELEASE_BUFFERS only frees openssl's record buffers, most of the tls cost sits in
+    asio::ssl::stream itself: two 17KB buffers of its own plus a 17KB each way bio pair, kept
+    for the whole life of the stream. trimming that means driving openssl through our own bio.
+
+    linux only, since the rss comes from /proc/<pid>/status.
+    raise the open files limit (ulimit -n) on both sides for large connection counts.
+*/
+// g++ asio_idle_memory_bench.cpp -DASIO_STANDALONE -I asio/include -l ssl -l crypto -lpthread -std=c++11 -o idle_bench
+int main(int argc, char* argv[]) {
+    if (argc != 6) {
+        std::cerr << "idle memory bench usage: " << argv[0] << " <tcp|tls> <ip> <port> <connections> <server pid>\n";
+        return 1;
+    }
+
+    const bool use_tls = std::strcmp(argv[1], "tls") == 0;
+    if (!use_tls && std::strcmp(argv[1], "tcp") != 0) {
+        std::cerr << "invalid mode, must be tcp or tls\n";
+        return 1;
+    }
+
+    int port = parse_port(argv[3]);
+    if (port < 0) {
+        std::cerr << "invalid port\n";
+        return 1;
+    }
+
+    int count = std::atoi(argv[4]);
+    if (count <= 0) {
+        std::cerr << "invalid connections\n";
+        return 1;
+    }
+
+    const std::string pid = argv[5];
+    const long rss_before = read_rss_kb(pid);
+    if (rss_before < 0) {
+        std::cerr << "read rss of process " << pid << " failed\n";
+        return 1;
+    }
+
+    asio::error_code ec;
+    asio::io_context ioc;
+    asio::ip::tcp::endpoint ep{ asio::ip::make_address(argv[2], ec), (asio::ip::port_type)port };
+    if (ec) {
+        std::cerr << "invalid ip, " << ec.value() << ", " << ec.message() << "\n";
+        return 1;
+    }
+
+    // the context must outlive every ssl stream created from it.
+    std::unique_ptr<asio::ssl::context> sslCtx;
+    std::vector<std::unique_ptr<asio::ip::tcp::socket>> tcp_connections;
+    std::vector<std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket>>> ssl_connections;
+    bool opened = false;
+
+    if (use_tls) {
+        sslCtx.reset(new asio::ssl::context{ create_ssl_context() });
+        opened = open_idle_ssl_connections(ioc, *sslCtx, ep, count, ssl_connections);
+    }
+    else {
+        opened = open_idle_connections(ioc, ep, count, tcp_connections);
+    }
+
+    if (!opened) {
+        return 1;
+    }
+
+    // give the server a moment to settle every accepted connection into its idle state.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    const long rss_after = read_rss_kb(pid);
+    if (rss_after < 0) {
+        std::cerr << "read rss of process " << pid << " failed\n";
+        return 1;
+    }
+
+    std::cout << "mode: " << argv[1] << "\n";
+    std::cout << "idle connections: " << count << "\n";
+    std::cout << "server rss before: " << rss_before << " KB, after: " << rss_after << " KB\n";
+    std::cout << "rss per idle connection: " << (double)(rss_after - rss_before) * 1024 / count << " bytes\n";
+
+    return 0;
+}
@@ -0,0 +1,187 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <cstdlib>
+#include <asio.hpp>
+#include "parse_port.hpp"
+#include "shm_ring.hpp"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std::chrono;
+
+void print_latency(const std::string& transport, std::vector<double>& samples_us) {
+    if (samples_us.empty()) {
+        return;
+    }
+
+    std::sort(samples_us.begin(), samples_us.end());
+
+    double total = 0;
+    for (double v : samples_us) {
+        total += v;
+    }
+
+    std::cout << transport << ": ";
+    std::cout << "avg=" << total / samples_us.size() << "us ";
+    std::cout << "p50=" << samples_us[samples_us.size() / 2] << "us ";
+    std::cout << "p99=" << samples_us[samples_us.size() * 99 / 100] << "us ";
+    std::cout << "max=" << samples_us.back() << "us\n";
+}
+
+// one round trip is a full message written and the same number of bytes read back.
+template<typename Socket>
+std::vector<double> stream_round_trips(Socket& s, const std::string& message, int iterations) {
+    std::vector<double> samples_us;
+    std::array<char, 256> buf{};
+    asio::error_code ec;
+
+    for (int i = 0; i < iterations; ++i) {
+        auto time_start = steady_clock::now();
+
+        asio::write(s, asio::buffer(message), ec);
+        if (!ec) {
+            asio::read(s, asio::buffer(buf.data(), message.size()), ec);
+        }
+
+        auto time_end = steady_clock::now();
+
+        if (ec) {
+            std::cerr << "round trip failed, " << ec.value() << ", " << ec.message() << "\n";
+            break;
+        }
+
+        samples_us.push_back(duration_cast<nanoseconds>(time_end - time_start).count() / 1000.0);
+    }
+
+    return samples_us;
+}
+
+std::vector<double> shm_round_trips(asio::local::stream_protocol::socket& control, const std::string& message, int iterations) {
+    std::vector<double> samples_us;
+
+    int fds[SHM_FD_COUNT] = { -1, -1, -1 };
+    if (!recv_fds(control.native_handle(), fds, SHM_FD_COUNT)) {
+        std::cerr << "shm descriptors receive failed\n";
+        return samples_us;
+    }
+
+    const int memfd = fds[0];
+    const int request_event_fd = fds[1];
+    const int response_event_fd = fds[2];
+
+    void* addr = ::mmap(nullptr, sizeof(shm_channel), PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    ::close(memfd);
+
+    if (addr == MAP_FAILED) {
+        std::cerr << "memfd map failed, " << errno << ", " << std::strerror(errno) << "\n";
+        ::close(request_event_fd);
+        ::close(response_event_fd);
+        return samples_us;
+    }
+
+    shm_channel* channel = static_cast<shm_channel*>(addr);
+    const uint64_t one = 1;
+    uint64_t count = 0;
+
+    for (int i = 0; i < iterations; ++i) {
+        auto time_start = steady_clock::now();
+
+        bool ok = channel->requests.push(message.data(), message.size()) &&
+            ::write(request_event_fd, &one, sizeof(one)) == sizeof(one);
+
+        const shm_slot* slot = nullptr;
+        while (ok && (slot = channel->responses.front()) == nullptr) {
+            ok = ::read(response_event_fd, &count, sizeof(count)) == sizeof(count);
+        }
+
+        auto time_end = steady_clock::now();
+
+        if (!ok || slot->len != message.size()) {
+            std::cerr << "shm round trip failed\n";
+            break;
+        }
+
+        channel->responses.pop();
+        samples_us.push_back(duration_cast<nanoseconds>(time_end - time_start).count() / 1000.0);
+    }
+
+    ::munmap(addr, sizeof(shm_channel));
+    ::close(request_event_fd);
+    ::close(response_event_fd);
+    return samples_us;
+}
+
+/*
+    compares echo round trip latency over tcp loopback, a unix domain socket and the shared memory ring.
+    start the server with all three transports first, e.g.
+    ./server 8080 /tmp/echo.sock /tmp/echo_shm.sock > /dev/null
+
+    linux only, since the shared memory transport is built on memfd and eventfd.
+*/
+// g++ asio_local_latency_bench.cpp -DASIO_STANDALONE -I asio/include -lpthread -std=c++11 -o latency_bench
+int main(int argc, char* argv[]) {
+    if (argc != 4 && argc != 5) {
+        std::cerr << "latency bench usage: " << argv[0] << " <port> <unix socket path> <shm control socket path> [iterations]\n";
+        return 1;
+    }
+
+    int port = parse_port(argv[1]);
+    if (port < 0) {
+        std::cerr << "invalid port\n";
+        return 1;
+    }
+
+    int iterations = argc == 5 ? std::atoi(argv[4]) : 10000;
+    if (iterations <= 0) {
+        std::cerr << "invalid iterations\n";
+        return 1;
+    }
+
+    const std::string message(32, 'A');
+
+    asio::error_code ec;
+    asio::io_context ioc;
+
+    asio::ip::tcp::socket tcp_socket{ ioc };
+    tcp_socket.connect(asio::ip::tcp::endpoint{ asio::ip::address_v4::loopback(), (asio::ip::port_type)port }, ec);
+    if (ec) {
+        std::cerr << "tcp connect failed, " << ec.value() << ", " << ec.message() << "\n";
+        return 1;
+    }
+
+    tcp_socket.set_option(asio::ip::tcp::no_delay(true), ec);
+
+    std::vector<double> tcp_samples = stream_round_trips(tcp_socket, message, iterations);
+    print_latency("tcp loopback", tcp_samples);
+
+    asio::local::stream_protocol::socket local_socket{ ioc };
+    local_socket.connect(asio::local::stream_protocol::endpoint{ argv[2] }, ec);
+    if (ec) {
+        std::cerr << "unix socket connect failed, " << ec.value() << ", " << ec.message() << "\n";
+        return 1;
+    }
+
+    std::vector<double> local_samples = stream_round_trips(local_socket, message, iterations);
+    print_latency("unix socket", local_samples);
+
+    asio::local::stream_protocol::socket control{ ioc };
+    control.connect(asio::local::stream_protocol::endpoint{ argv[3] }, ec);
+    if (ec) {
+        std::cerr << "shm control socket connect failed, " << ec.value() << ", " << ec.message() << "\n";
+        return 1;
+    }
+
+    std::vector<double> shm_samples = shm_round_trips(control, message, iterations);
+    print_latency("shared memory", shm_samples);
+
+    return 0;
+}
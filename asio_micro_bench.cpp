@@ -0,0 +1,476 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <utility>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// the measured primitives live in the same headers the programs are built from.
+#include "parse_port.hpp"
+#include "icmp_checksum.hpp"
+#include "echo_metrics.hpp"
+#include "echo_common.hpp"
+#include "ssl_echo_context.hpp"
+
+// the end to end round trip runs against the real server binary, cmake passes its path.
+#ifndef ECHO_SERVER_PATH
+#define ECHO_SERVER_PATH "./asio_echo_server"
+#endif
+
+using namespace std::chrono;
+
+struct bench_result {
+    std::string name;
+    long iterations;
+    double ns_per_op;
+    double p50_ns;
+    double p99_ns;
+    std::string error;
+};
+
+// keeps the compiler from dropping the measured calls.
+volatile uint64_t bench_sink = 0;
+
+template<typename Op>
+bench_result run_bench(const std::string& name, long iterations, Op op) {
+    for (long i = 0; i < iterations / 10 + 1; ++i) {
+        op();
+    }
+
+    auto time_start = steady_clock::now();
+    for (long i = 0; i < iterations; ++i) {
+        op();
+    }
+    auto time_end = steady_clock::now();
+
+    const double total_ns = (double)duration_cast<nanoseconds>(time_end - time_start).count();
+    return bench_result{ name, iterations, total_ns / iterations, 0, 0, "" };
+}
+
+// for operations slow enough to time one by one, so percentiles come along.
+// op times itself and reports the nanoseconds spent in the part being measured.
+template<typename Op>
+bench_result run_self_timed_bench(const std::string& name, long iterations, Op op) {
+    std::vector<double> samples;
+    samples.reserve(iterations);
+
+    for (long i = 0; i < iterations; ++i) {
+        double elapsed_ns = 0;
+        if (!op(elapsed_ns)) {
+            return bench_result{ name, i, 0, 0, 0, "operation failed" };
+        }
+
+        samples.push_back(elapsed_ns);
+    }
+
+    double total = 0;
+    for (double v : samples) {
+        total += v;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    return bench_result{ name, iterations, total / iterations, samples[samples.size() / 2], samples[samples.size() * 99 / 100], "" };
+}
+
+template<typename Op>
+bench_result run_sampled_bench(const std::string& name, long iterations, Op op) {
+    return run_self_timed_bench(name, iterations, [&op](double& elapsed_ns) {
+        auto time_start = steady_clock::now();
+        const bool ok = op();
+        auto time_end = steady_clock::now();
+
+        elapsed_ns = (double)duration_cast<nanoseconds>(time_end - time_start).count();
+        return ok;
+    });
+}
+
+bench_result failed_bench(const std::string& name, const std::string& error) {
+    return bench_result{ name, 0, 0, 0, 0, error };
+}
+
+std::string json_escape(const std::string& s) {
+    std::string out;
+
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            out += ' ';
+        }
+        else {
+            out += c;
+        }
+    }
+
+    return out;
+}
+
+void write_json(std::ostream& out, const std::vector<bench_result>& results) {
+#ifdef __VERSION__
+    const char* compiler = __VERSION__;
+#else
+    const char* compiler = "unknown";
+#endif
+
+    out << "{\n";
+    out << "  \"context\": { \"compiler\": \"" << json_escape(compiler) << "\" },\n";
+    out << "  \"benchmarks\": [\n";
+
+    for (std::size_t i = 0; i < results.size(); ++i) {
+        const bench_result& r = results[i];
+
+        out << "    { \"name\": \"" << json_escape(r.name) << "\", \"iterations\": " << r.iterations;
+        out << ", \"ns_per_op\": " << r.ns_per_op;
+
+        if (r.p50_ns > 0) {
+            out << ", \"p50_ns\": " << r.p50_ns << ", \"p99_ns\": " << r.p99_ns;
+        }
+
+        if (!r.error.empty()) {
+            out << ", \"error\": \"" << json_escape(r.error) << "\"";
+        }
+
+        out << " }" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+
+    out << "  ]\n";
+    out << "}\n";
+}
+
+std::vector<bench_result> bench_calc_checksum() {
+    std::vector<bench_result> results;
+
+    // an icmp echo request with the 32 bytes of data ping sends, and a full 1024 byte buffer.
+    const std::size_t sizes[] = { sizeof(IcmpHeader) + 32, 1024 };
+
+    for (std::size_t size : sizes) {
+        std::vector<uint16_t> packet((size + 1) / 2);
+        for (std::size_t i = 0; i < packet.size(); ++i) {
+            packet[i] = (uint16_t)(i * 2654435761u);
+        }
+
+        results.push_back(run_bench("calc_checksum/" + std::to_string(size), 5000000, [&packet, size]() {
+            bench_sink += calc_checksum(packet.data(), size);
+        }));
+    }
+
+    return results;
+}
+
+std::vector<bench_result> bench_parse_port() {
+    std::vector<bench_result> results;
+    const char* inputs[] = { "80", "65535", "65536", "80a" };
+
+    for (const char* input : inputs) {
+        results.push_back(run_bench(std::string{ "parse_port/" } + input, 20000000, [input]() {
+            bench_sink += (uint64_t)parse_port(input);
+        }));
+    }
+
+    return results;
+}
+
+// send_all is templated on the stream, so it runs over a real socketpair here.
+// it writes asynchronously, so each op runs the io_context until the write completes.
+bench_result bench_send_all(asio::io_context& ioc) {
+    asio::error_code ec;
+    asio::local::stream_protocol::socket writer{ ioc };
+    asio::local::stream_protocol::socket reader{ ioc };
+
+    asio::local::connect_pair(writer, reader, ec);
+    if (ec) {
+        return failed_bench("send_all/socketpair/256", "connect_pair failed, " + ec.message());
+    }
+
+    std::array<char, 256> buf{};
+    std::array<char, 256> sink{};
+
+    return run_bench("send_all/socketpair/256", 200000, [&]() {
+        send_all(writer, buf, buf.size(), [](const asio::error_code&) {});
+        ioc.run();
+        ioc.restart();
+
+        asio::error_code read_ec;
+        asio::read(reader, asio::buffer(sink), read_ec);
+    });
+}
+
+// returns a connected loopback tcp pair.
+bool make_tcp_pair(asio::io_context& ioc, asio::ip::tcp::socket& server_side, asio::ip::tcp::socket& client_side) {
+    asio::error_code ec;
+    asio::ip::tcp::acceptor acc{ ioc, asio::ip::tcp::endpoint{ asio::ip::address_v4::loopback(), 0 } };
+
+    client_side.connect(acc.local_endpoint(), ec);
+    if (ec) {
+        return false;
+    }
+
+    acc.accept(server_side, ec);
+    if (ec) {
+        return false;
+    }
+
+    server_side.set_option(asio::ip::tcp::no_delay(true), ec);
+    client_side.set_option(asio::ip::tcp::no_delay(true), ec);
+    return true;
+}
+
+asio::ssl::context create_client_ssl_context() {
+    asio::ssl::context ctx{ asio::ssl::context::tls_client };
+
+    ctx.set_options(
+        asio::ssl::context::default_workarounds |
+        asio::ssl::context::no_sslv2 |
+        asio::ssl::context::no_sslv3 |
+        asio::ssl::context::no_tlsv1 |
+        asio::ssl::context::no_tlsv1_1 |
+        asio::ssl::context::single_dh_use
+    );
+
+    // the handshake cost is measured, not the certificate chain, so any server.crt will do.
+    ctx.set_verify_mode(asio::ssl::verify_none);
+
+    return ctx;
+}
+
+// runs the client side handshake on its own thread, the server side on this one.
+bool ssl_handshake_pair(asio::ssl::stream<asio::ip::tcp::socket>& server_side, asio::ssl::stream<asio::ip::tcp::socket>& client_side) {
+    asio::error_code client_ec;
+    std::thread client_thread{ [&client_side, &client_ec]() {
+        client_side.handshake(asio::ssl::stream_base::client, client_ec);
+    } };
+
+    asio::error_code server_ec;
+    server_side.handshake(asio::ssl::stream_base::server, server_ec);
+    client_thread.join();
+
+    return !server_ec && !client_ec;
+}
+
+// same as ssl_handshake_pair, but the client thread is already waiting when the clock starts,
+// so only the two handshakes are timed, not the thread start or join.
+bool timed_ssl_handshake_pair(asio::ssl::stream<asio::ip::tcp::socket>& server_side, asio::ssl::stream<asio::ip::tcp::socket>& client_side, double& elapsed_ns) {
+    std::atomic<bool> ready{ false };
+    std::atomic<bool> go{ false };
+    std::atomic<bool> client_done{ false };
+    asio::error_code client_ec;
+
+    std::thread client_thread{ [&]() {
+        ready.store(true, std::memory_order_release);
+        while (!go.load(std::memory_order_acquire)) {
+            std::this_thread::yield();
+        }
+
+        client_side.handshake(asio::ssl::stream_base::client, client_ec);
+        client_done.store(true, std::memory_order_release);
+    } };
+
+    while (!ready.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    auto time_start = steady_clock::now();
+    go.store(true, std::memory_order_release);
+
+    asio::error_code server_ec;
+    server_side.handshake(asio::ssl::stream_base::server, server_ec);
+
+    while (!client_done.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+
+    auto time_end = steady_clock::now();
+    client_thread.join();
+
+    elapsed_ns = (double)duration_cast<nanoseconds>(time_end - time_start).count();
+    return !server_ec && !client_ec;
+}
+
+std::vector<bench_result> bench_ssl(asio::io_context& ioc) {
+    std::vector<bench_result> results;
+
+    std::unique_ptr<asio::ssl::context> server_ctx;
+    try {
+        server_ctx.reset(new asio::ssl::context{ create_ssl_context() });
+    }
+    catch (const std::exception& e) {
+        const std::string error = std::string{ "create_ssl_context failed, server.crt and server.key must be in the working directory, " } + e.what();
+        results.push_back(failed_bench("ssl_handshake/loopback", error));
+        results.push_back(failed_bench("send_all/tls_loopback/256", error));
+        return results;
+    }
+
+    asio::ssl::context client_ctx = create_client_ssl_context();
+
+    // the tcp pair is connected before timing starts, only the tls handshake is measured.
+    results.push_back(run_self_timed_bench("ssl_handshake/loopback", 200, [&](double& elapsed_ns) {
+        asio::ssl::stream<asio::ip::tcp::socket> server_side{ ioc, *server_ctx };
+        asio::ssl::stream<asio::ip::tcp::socket> client_side{ ioc, client_ctx };
+
+        return make_tcp_pair(ioc, server_side.next_layer(), client_side.next_layer()) &&
+            timed_ssl_handshake_pair(server_side, client_side, elapsed_ns);
+    }));
+
+    // the same send_all over a tls stream, a loopback tcp pair stands in for the socketpair.
+    asio::ssl::stream<asio::ip::tcp::socket> server_side{ ioc, *server_ctx };
+    asio::ssl::stream<asio::ip::tcp::socket> client_side{ ioc, client_ctx };
+
+    if (!make_tcp_pair(ioc, server_side.next_layer(), client_side.next_layer()) || !ssl_handshake_pair(server_side, client_side)) {
+        results.push_back(failed_bench("send_all/tls_loopback/256", "ssl connection setup failed"));
+        return results;
+    }
+
+    std::array<char, 256> buf{};
+    std::array<char, 256> sink{};
+
+    results.push_back(run_bench("send_all/tls_loopback/256", 100000, [&]() {
+        send_all(server_side, buf, buf.size(), [](const asio::error_code&) {});
+        ioc.run();
+        ioc.restart();
+
+        asio::error_code read_ec;
+        asio::read(client_side, asio::buffer(sink), read_ec);
+    }));
+
+    return results;
+}
+
+// starts the echo server binary on the given port with its stdout discarded, -1 on failure.
+pid_t spawn_echo_server(int port) {
+    const std::string port_arg = std::to_string(port);
+
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        int null_fd = ::open("/dev/null", O_WRONLY);
+        if (null_fd >= 0) {
+            ::dup2(null_fd, STDOUT_FILENO);
+            ::close(null_fd);
+        }
+
+        ::execl(ECHO_SERVER_PATH, ECHO_SERVER_PATH, port_arg.c_str(), (char*)nullptr);
+        ::_exit(127);
+    }
+
+    return pid;
+}
+
+// runs the real echo server as a child process and times full round trips against it.
+bench_result bench_echo_round_trip(asio::io_context& ioc) {
+    const std::string name = "echo_round_trip/tcp_loopback/32";
+    asio::error_code ec;
+
+    // borrow a free port from the kernel, the server binds it again right after.
+    int port = 0;
+    {
+        asio::ip::tcp::acceptor probe{ ioc, asio::ip::tcp::endpoint{ asio::ip::address_v4::loopback(), 0 } };
+        port = probe.local_endpoint().port();
+    }
+
+    pid_t server_pid = spawn_echo_server(port);
+    if (server_pid < 0) {
+        return failed_bench(name, "fork failed");
+    }
+
+    asio::ip::tcp::socket s{ ioc };
+    asio::ip::tcp::endpoint ep{ asio::ip::address_v4::loopback(), (asio::ip::port_type)port };
+
+    for (int i = 0; i < 100; ++i) {
+        s.connect(ep, ec);
+        if (!ec) {
+            break;
+        }
+
+        s.close();
+        std::this_thread::sleep_for(milliseconds(10));
+    }
+
+    bench_result result;
+    if (ec) {
+        result = failed_bench(name, "connect to " ECHO_SERVER_PATH " failed, " + ec.message());
+    }
+    else {
+        s.set_option(asio::ip::tcp::no_delay(true), ec);
+
+        const std::string message(32, 'A');
+        std::array<char, 32> buf{};
+
+        result = run_sampled_bench(name, 20000, [&]() {
+            asio::error_code round_trip_ec;
+
+            asio::write(s, asio::buffer(message), round_trip_ec);
+            if (!round_trip_ec) {
+                asio::read(s, asio::buffer(buf), round_trip_ec);
+            }
+
+            return !round_trip_ec;
+        });
+    }
+
+    s.close(ec);
+    ::kill(server_pid, SIGTERM);
+    ::waitpid(server_pid, nullptr, 0);
+    return result;
+}
+
+/*
+    micro benchmarks for the primitives the programs are built from, the results come out as json
+    so two runs, e.g. from two commits, can be diffed or fed to a comparison script.
+    run it where server.crt and server.key live, otherwise the tls entries carry an error instead.
+*/
+// cmake --build build --target asio_micro_bench && ./build/asio_micro_bench bench.json
+int main(int argc, char* argv[]) {
+    if (argc > 2) {
+        std::cerr << "micro bench usage: " << argv[0] << " [output json path]\n";
+        return 1;
+    }
+
+    asio::io_context ioc;
+    std::vector<bench_result> results;
+
+    for (const auto& r : bench_calc_checksum()) {
+        results.push_back(r);
+    }
+
+    for (const auto& r : bench_parse_port()) {
+        results.push_back(r);
+    }
+
+    results.push_back(bench_send_all(ioc));
+
+    for (const auto& r : bench_ssl(ioc)) {
+        results.push_back(r);
+    }
+
+    results.push_back(bench_echo_round_trip(ioc));
+
+    if (argc == 2) {
+        std::ofstream file{ argv[1] };
+        if (!file) {
+            std::cerr << "open " << argv[1] << " failed\n";
+            return 1;
+        }
+
+        write_json(file, results);
+    }
+    else {
+        write_json(std::cout, results);
+    }
+
+    return 0;
+}
@@ -18,6 +18,7 @@
 #include <chrono>
 #include <cstdint>
 #include <asio.hpp>
+#include "icmp_checksum.hpp"
 
 using namespace std::chrono;
 
@@ -37,33 +38,6 @@ struct alignas(4) IpHeader {
 	// cause the options and padding have no usage in this program, they are just ignored.
 };
 
-// rfc 792.
-struct alignas(2) IcmpHeader {
-	uint8_t type;
-	uint8_t code;
-	uint16_t checksum;
-	uint16_t identifier;
-	uint16_t sequence;
-};
-
-uint16_t calc_checksum(const uint16_t* data, size_t len) {
-	uint32_t result = 0;
-
-	while (len > 1) {
-		result += *data;
-		++data;
-		len -= 2;
-	}
-
-	if (len > 0) {
-		result += *reinterpret_cast<const uint8_t*>(data);
-	}
-
-	result = (result >> 16) + (result & 0xffff);
-	result += (result >> 16);
-	return static_cast<uint16_t>(~result);
-}
-
 uint16_t get_current_process_id() {
 #ifdef _WIN32
 	return (uint16_t)GetCurrentProcessId();
@@ -177,7 +151,8 @@ int main(int argc, char* argv[]) {
 	asio::io_context ioc;
 	asio::ip::icmp::resolver host_resolver{ ioc };
 
-	auto results = host_resolver.resolve(argv[1], "", ec);
+	// the socket is opened with icmp::v4, so only ask for A records.
+	auto results = host_resolver.resolve(asio::ip::icmp::v4(), argv[1], "", ec);
 	if (ec) {
 		std::cerr << "resolve host failed, " << ec.value() << ", " << ec.message() << "\n";
 		return 1;
@@ -0,0 +1,107 @@
+#ifndef ECHO_COMMON_HPP
+#define ECHO_COMMON_HPP
+
+#include <iostream>
+#include <utility>
+#include <array>
+#include <memory>
+#include <vector>
+#include <chrono>
+#include <cerrno>
+#include <asio.hpp>
+#include "echo_metrics.hpp"
+
+// writes the first len bytes asynchronously, a client that doesn't read only stalls itself.
+// buf must stay alive until handler runs.
+template<typename Stream, std::size_t N, typename Handler>
+void send_all(Stream& connection, const std::array<char, N>& buf, std::size_t len, Handler handler) {
+    asio::async_write(connection, asio::buffer(buf.data(), len), [handler](const asio::error_code& ec, std::size_t written) {
+        if (ec) {
+            std::cerr << "one connection send failed, " << ec.value() << ", " << ec.message() << "\n";
+            local_metrics().errors.record(ec);
+        }
+        else {
+            thread_metrics& metrics = local_metrics();
+            metrics.bytes_out.add(written);
+            metrics.write_bytes.observe((double)written);
+        }
+
+        handler(ec);
+    });
+}
+
+// receive buffers are only borrowed while a connection is reading and echoing,
+// an idle tcp connection just waits for readiness and owns no buffer at all.
+class buffer_pool {
+public:
+    using buffer = std::array<char, 256>;
+
+    explicit buffer_pool(std::size_t max_cached) noexcept : max_cached_{ max_cached } {}
+
+    std::unique_ptr<buffer> acquire() {
+        if (free_.empty()) {
+            return std::unique_ptr<buffer>{ new buffer };
+        }
+
+        std::unique_ptr<buffer> buf = std::move(free_.back());
+        free_.pop_back();
+        return buf;
+    }
+
+    void release(std::unique_ptr<buffer>&& buf) {
+        if (free_.size() < max_cached_) {
+            free_.emplace_back(std::move(buf));
+        }
+    }
+
+private:
+    std::size_t max_cached_;
+    std::vector<std::unique_ptr<buffer>> free_;
+};
+
+// running out of descriptors or memory is expected at high connection counts,
+// so accept waits a little before trying again instead of spinning on the same error.
+const int ACCEPT_RETRY_MILLISEC = 100;
+
+inline int accept_retry_delay_millisec(const asio::error_code& ec) {
+    if (ec == asio::error::no_descriptors ||
+        ec == asio::error_code(ENFILE, asio::system_category()) ||
+        ec == asio::error::no_buffer_space ||
+        ec == asio::error::no_memory) {
+        return ACCEPT_RETRY_MILLISEC;
+    }
+
+    return 0;
+}
+
+template<typename Protocol, typename Handler>
+void accept_connections(asio::basic_socket_acceptor<Protocol>& acc, Handler handler) {
+    acc.async_accept([&acc, handler](const asio::error_code& ec, typename Protocol::socket client) {
+        if (ec) {
+            if (ec == asio::error::operation_aborted) {
+                return;
+            }
+
+            std::cerr << "acceptor accept failed, " << ec.value() << ", " << ec.message() << "\n";
+            local_metrics().errors.record(ec);
+
+            const int delay = accept_retry_delay_millisec(ec);
+            if (delay == 0) {
+                accept_connections(acc, handler);
+                return;
+            }
+
+            auto timer = std::make_shared<asio::steady_timer>(acc.get_executor(), std::chrono::milliseconds(delay));
+            timer->async_wait([&acc, handler, timer](const asio::error_code&) {
+                accept_connections(acc, handler);
+            });
+
+            return;
+        }
+
+        handler(std::move(client));
+        accept_connections(acc, handler);
+    });
+}
+
+#endif
@@ -0,0 +1,329 @@
+#ifndef ECHO_METRICS_HPP
+#define ECHO_METRICS_HPP
+
+#include <iostream>
+#include <utility>
+#include <array>
+#include <memory>
+#include <string>
+#include <sstream>
+#include <map>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <asio.hpp>
+
+// metric blocks are written by their owning thread only, so a relaxed load and store
+// replaces a locked read-modify-write, and readers just sum every thread's block.
+class counter {
+public:
+    void add(uint64_t n) noexcept {
+        value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const noexcept {
+        return value_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value_{ 0 };
+};
+
+const std::array<double, 5> SIZE_BUCKETS = {{ 16, 32, 64, 128, 256 }};
+const std::array<double, 9> LATENCY_BUCKETS = {{ 0.00001, 0.00005, 0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1 }};
+const std::array<double, 10> HANDSHAKE_BUCKETS = {{ 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1 }};
+
+template<std::size_t N>
+class histogram {
+public:
+    explicit histogram(const std::array<double, N>& bounds) noexcept : bounds_{ bounds } {}
+
+    void observe(double v) noexcept {
+        std::size_t i = 0;
+        while (i < N && v > bounds_[i]) {
+            ++i;
+        }
+
+        buckets_[i].add(1);
+        sum_.store(sum_.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+    }
+
+    const std::array<double, N>& bounds() const noexcept { return bounds_; }
+    uint64_t bucket(std::size_t i) const noexcept { return buckets_[i].get(); }
+    double sum() const noexcept { return sum_.load(std::memory_order_relaxed); }
+
+private:
+    const std::array<double, N>& bounds_;
+    std::array<counter, N + 1> buckets_;
+    std::atomic<double> sum_{ 0 };
+};
+
+// error counts keyed by category and ec.value(), codes that don't fit end up in overflow.
+class error_table {
+public:
+    static const std::size_t SLOTS = 32;
+
+    void record(const asio::error_code& ec) noexcept {
+        const asio::error_category* category = &ec.category();
+
+        for (std::size_t i = 0; i < SLOTS; ++i) {
+            const std::size_t slot = ((std::size_t)ec.value() + i) % SLOTS;
+
+            if (!used_[slot].load(std::memory_order_relaxed)) {
+                categories_[slot].store(category, std::memory_order_relaxed);
+                values_[slot].store(ec.value(), std::memory_order_relaxed);
+                used_[slot].store(true, std::memory_order_release);
+            }
+            else if (values_[slot].load(std::memory_order_relaxed) != ec.value() ||
+                categories_[slot].load(std::memory_order_relaxed) != category) {
+                continue;
+            }
+
+            counts_[slot].add(1);
+            return;
+        }
+
+        overflow_.add(1);
+    }
+
+    template<typename Visitor>
+    void visit(Visitor visitor) const {
+        for (std::size_t i = 0; i < SLOTS; ++i) {
+            if (used_[i].load(std::memory_order_acquire)) {
+                visitor(categories_[i].load(std::memory_order_relaxed)->name(), values_[i].load(std::memory_order_relaxed), counts_[i].get());
+            }
+        }
+    }
+
+    uint64_t overflow() const noexcept { return overflow_.get(); }
+
+private:
+    std::array<std::atomic<bool>, SLOTS> used_{};
+    std::array<std::atomic<const asio::error_category*>, SLOTS> categories_{};
+    std::array<std::atomic<int>, SLOTS> values_{};
+    std::array<counter, SLOTS> counts_;
+    counter overflow_;
+};
+
+struct thread_metrics {
+    counter accepted;
+    counter opened;
+    counter closed;
+    counter bytes_in;
+    counter bytes_out;
+    histogram<5> read_bytes{ SIZE_BUCKETS };
+    histogram<5> write_bytes{ SIZE_BUCKETS };
+    histogram<9> handler_seconds{ LATENCY_BUCKETS };
+    histogram<10> handshake_seconds{ HANDSHAKE_BUCKETS }; // tls server only
+    error_table errors;
+
+    thread_metrics* next = nullptr;
+};
+
+// every thread's block is pushed onto this list once and never freed, so the totals survive the thread.
+inline std::atomic<thread_metrics*>& all_thread_metrics() {
+    static std::atomic<thread_metrics*> head{ nullptr };
+    return head;
+}
+
+inline thread_metrics* register_thread_metrics() {
+    thread_metrics* m = new thread_metrics;
+    thread_metrics* head = all_thread_metrics().load(std::memory_order_relaxed);
+
+    do {
+        m->next = head;
+    } while (!all_thread_metrics().compare_exchange_weak(head, m, std::memory_order_release, std::memory_order_relaxed));
+
+    return m;
+}
+
+inline thread_metrics& local_metrics() {
+    thread_local thread_metrics* m = register_thread_metrics();
+    return *m;
+}
+
+template<typename Getter>
+void render_counter(std::ostringstream& out, const char* name, const char* type, const char* help, Getter getter) {
+    uint64_t total = 0;
+    for (const thread_metrics* m = all_thread_metrics().load(std::memory_order_acquire); m != nullptr; m = m->next) {
+        total += getter(*m);
+    }
+
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " " << type << "\n";
+    out << name << " " << total << "\n";
+}
+
+template<std::size_t N, typename Getter>
+void render_histogram(std::ostringstream& out, const char* name, const char* help, Getter getter) {
+    std::array<uint64_t, N + 1> buckets{};
+    double sum = 0;
+    const std::array<double, N>* bounds = nullptr;
+
+    for (const thread_metrics* m = all_thread_metrics().load(std::memory_order_acquire); m != nullptr; m = m->next) {
+        const histogram<N>& h = getter(*m);
+        bounds = &h.bounds();
+        sum += h.sum();
+
+        for (std::size_t i = 0; i <= N; ++i) {
+            buckets[i] += h.bucket(i);
+        }
+    }
+
+    out << "# HELP " << name << " " << help << "\n";
+    out << "# TYPE " << name << " histogram\n";
+
+    uint64_t cumulative = 0;
+    for (std::size_t i = 0; i <= N; ++i) {
+        cumulative += buckets[i];
+
+        out << name << "_bucket{le=\"";
+        if (i < N && bounds != nullptr) {
+            out << (*bounds)[i];
+        }
+        else {
+            out << "+Inf";
+        }
+        out << "\"} " << cumulative << "\n";
+    }
+
+    out << name << "_sum " << sum << "\n";
+    out << name << "_count " << cumulative << "\n";
+}
+
+// prometheus text exposition format, version 0.0.4.
+// the handshake histogram is only rendered by the tls server, the plain one never fills it.
+inline std::string render_metrics(bool tls) {
+    std::ostringstream out;
+
+    render_counter(out, "echo_accepted_connections_total", "counter", "Connections accepted.",
+        [](const thread_metrics& m) { return m.accepted.get(); });
+    render_counter(out, "echo_active_connections", "gauge", "Connections currently open.",
+        [](const thread_metrics& m) { return m.opened.get() - m.closed.get(); });
+    render_counter(out, "echo_closed_connections_total", "counter", "Connections closed, by the peer or after an error.",
+        [](const thread_metrics& m) { return m.closed.get(); });
+    render_counter(out, "echo_received_bytes_total", "counter", "Bytes read from clients.",
+        [](const thread_metrics& m) { return m.bytes_in.get(); });
+    render_counter(out, "echo_sent_bytes_total", "counter", "Bytes written to clients.",
+        [](const thread_metrics& m) { return m.bytes_out.get(); });
+
+    render_histogram<5>(out, "echo_read_bytes", "Size of each read.",
+        [](const thread_metrics& m) -> const histogram<5>& { return m.read_bytes; });
+    render_histogram<5>(out, "echo_write_bytes", "Size of each write.",
+        [](const thread_metrics& m) -> const histogram<5>& { return m.write_bytes; });
+    render_histogram<9>(out, "echo_handler_seconds", "Time from reading one message until its echo has been written.",
+        [](const thread_metrics& m) -> const histogram<9>& { return m.handler_seconds; });
+    if (tls) {
+        render_histogram<10>(out, "echo_tls_handshake_seconds", "Time spent in the server side tls handshake.",
+            [](const thread_metrics& m) -> const histogram<10>& { return m.handshake_seconds; });
+    }
+
+    // the same code may sit in several threads' tables, sum them per label before printing.
+    std::map<std::pair<std::string, int>, uint64_t> errors;
+    uint64_t overflow = 0;
+
+    for (const thread_metrics* m = all_thread_metrics().load(std::memory_order_acquire); m != nullptr; m = m->next) {
+        m->errors.visit([&errors](const char* category, int value, uint64_t count) {
+            errors[std::make_pair(std::string{ category }, value)] += count;
+        });
+        overflow += m->errors.overflow();
+    }
+
+    out << "# HELP echo_errors_total Errors seen on connections, by error category and ec.value().\n";
+    out << "# TYPE echo_errors_total counter\n";
+    for (const auto& item : errors) {
+        out << "echo_errors_total{category=\"" << item.first.first << "\",code=\"" << item.first.second << "\"} " << item.second << "\n";
+    }
+    out << "echo_errors_total{category=\"other\",code=\"other\"} " << overflow << "\n";
+
+    return out.str();
+}
+
+// a scrape request is a few hundred bytes, anything larger or slower is dropped.
+const std::size_t METRICS_REQUEST_MAX_BYTES = 8192;
+const int METRICS_TIMEOUT_MILLISEC = 5000;
+
+// answers any http request on the admin port with the current metrics.
+class metrics_connection : public std::enable_shared_from_this<metrics_connection> {
+public:
+    metrics_connection(asio::ip::tcp::socket&& connection, bool tls)
+        : connection_{ std::move(connection) }, request_{ METRICS_REQUEST_MAX_BYTES }, deadline_{ connection_.get_executor() }, tls_{ tls } {}
+
+    void start() {
+        auto self = shared_from_this();
+
+        // closing the socket aborts whichever read or write is still pending.
+        deadline_.expires_after(std::chrono::milliseconds(METRICS_TIMEOUT_MILLISEC));
+        deadline_.async_wait([this, self](const asio::error_code& ec) {
+            if (!ec) {
+                close();
+            }
+        });
+
+        asio::async_read_until(connection_, request_, "\r\n\r\n", [this, self](const asio::error_code& ec, std::size_t) {
+            if (ec) {
+                close();
+                return;
+            }
+
+            const std::string body = render_metrics(tls_);
+            response_ = "HTTP/1.0 200 OK\r\n"
+                "Content-Type: text/plain; version=0.0.4\r\n"
+                "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                "Connection: close\r\n\r\n" + body;
+
+            asio::async_write(connection_, asio::buffer(response_), [this, self](const asio::error_code&, std::size_t) {
+                close();
+            });
+        });
+    }
+
+private:
+    void close() {
+        asio::error_code ec;
+        deadline_.cancel();
+        connection_.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        connection_.close(ec);
+    }
+
+    asio::ip::tcp::socket connection_;
+    asio::streambuf request_;
+    asio::steady_timer deadline_;
+    std::string response_;
+    bool tls_;
+};
+
+inline bool open_metrics_acceptor(asio::ip::tcp::acceptor& acc, int port) {
+    asio::error_code ec;
+
+    // metrics are for local scrapers only, never listen on a public address.
+    asio::ip::tcp::endpoint ep{ asio::ip::address_v4::loopback(), (asio::ip::port_type)port };
+
+    acc.open(ep.protocol(), ec);
+    if (ec) {
+        std::cerr << "metrics acceptor open failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    acc.set_option(asio::ip::tcp::acceptor::reuse_address(true), ec);
+    if (ec) {
+        std::cerr << "set option failed on reuse address, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    acc.bind(ep, ec);
+    if (ec) {
+        std::cerr << "metrics acceptor bind failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    acc.listen(asio::socket_base::max_listen_connections, ec);
+    if (ec) {
+        std::cerr << "metrics acceptor listen failed, " << ec.value() << ", " << ec.message() << "\n";
+        return false;
+    }
+
+    return true;
+}
+
+#endif
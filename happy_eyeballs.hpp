@@ -0,0 +1,272 @@
+#ifndef HAPPY_EYEBALLS_HPP
+#define HAPPY_EYEBALLS_HPP
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <asio.hpp>
+
+// rfc 8305 section 3 and 5 recommended defaults.
+const int RESOLUTION_DELAY_MILLISEC = 50;
+const int CONNECTION_ATTEMPT_DELAY_MILLISEC = 250;
+
+// rfc 8305 happy eyeballs: resolves AAAA and A at the same time, then races staggered
+// connection attempts over every resolved endpoint, the first one to connect wins.
+class happy_eyeballs_connector : public std::enable_shared_from_this<happy_eyeballs_connector> {
+public:
+    using handler_type = std::function<void(const asio::error_code&, asio::ip::tcp::socket&&)>;
+
+    happy_eyeballs_connector(asio::io_context& ioc, const std::string& host, int port, handler_type handler)
+        : ioc_{ ioc }, resolution_timer_{ ioc }, attempt_timer_{ ioc }, lookup_work_{ ioc.get_executor() },
+          host_{ host }, service_{ std::to_string(port) }, handler_{ std::move(handler) },
+          mailbox_{ std::make_shared<lookup_mailbox>() } {}
+
+    void start() {
+        mailbox_->owner = shared_from_this();
+
+        lookup(asio::ip::tcp::v6());
+        lookup(asio::ip::tcp::v4());
+    }
+
+    // skips dns and races the given endpoints, they are tried in order within each address family.
+    void start(const std::vector<asio::ip::tcp::endpoint>& endpoints) {
+        for (const auto& ep : endpoints) {
+            (ep.address().is_v6() ? v6_endpoints_ : v4_endpoints_).push_back(ep);
+        }
+
+        v6_resolved_ = true;
+        v4_resolved_ = true;
+        started_ = true;
+        try_next();
+
+        // dropping the last work of an io_context stops it, so the guard goes only once an attempt is pending.
+        lookup_work_.reset();
+    }
+
+private:
+    // the lookup threads hand their results back through here, once the race is over nothing is delivered.
+    struct lookup_mailbox {
+        std::mutex mutex;
+        std::shared_ptr<happy_eyeballs_connector> owner;
+    };
+
+    // asio runs every async_resolve of an io_context on one internal thread and cannot cancel a
+    // getaddrinfo in progress, so each family gets its own thread and a slow lookup is simply abandoned.
+    void lookup(const asio::ip::tcp& family) {
+        std::shared_ptr<lookup_mailbox> mailbox = mailbox_;
+        const std::string host = host_;
+        const std::string service = service_;
+
+        std::thread([mailbox, family, host, service]() {
+            asio::io_context lookup_ioc;
+            asio::ip::tcp::resolver resolver{ lookup_ioc };
+
+            asio::error_code ec;
+            asio::ip::tcp::resolver::results_type results = resolver.resolve(family, host, service, asio::ip::tcp::resolver::numeric_service, ec);
+
+            std::lock_guard<std::mutex> lock{ mailbox->mutex };
+            if (mailbox->owner) {
+                std::shared_ptr<happy_eyeballs_connector> owner = mailbox->owner;
+                const bool is_v6 = family == asio::ip::tcp::v6();
+
+                asio::post(owner->ioc_, [owner, is_v6, ec, results]() {
+                    owner->on_resolved(is_v6, ec, results);
+                });
+            }
+        }).detach();
+    }
+
+    void on_resolved(bool is_v6, const asio::error_code& ec, const asio::ip::tcp::resolver::results_type& results) {
+        (is_v6 ? v6_resolved_ : v4_resolved_) = true;
+
+        if (done_) {
+            return;
+        }
+
+        if (v6_resolved_ && v4_resolved_) {
+            close_mailbox();
+        }
+
+        if (ec) {
+            // a failed connect attempt says more than the other family having no address.
+            if (!last_error_) {
+                last_error_ = ec;
+            }
+        }
+        else {
+            auto& queue = is_v6 ? v6_endpoints_ : v4_endpoints_;
+            for (const auto& item : results) {
+                queue.push_back(item.endpoint());
+            }
+        }
+
+        if (!started_) {
+            // an A answer waits a little for the AAAA one, so ipv6 still gets the first try.
+            if (!is_v6 && !v6_resolved_) {
+                auto self = shared_from_this();
+
+                resolution_timer_.expires_after(std::chrono::milliseconds(RESOLUTION_DELAY_MILLISEC));
+                resolution_timer_.async_wait([this, self](const asio::error_code& ec) {
+                    if (!ec && !started_ && !done_) {
+                        started_ = true;
+                        try_next();
+                    }
+                });
+
+                return;
+            }
+
+            resolution_timer_.cancel();
+            started_ = true;
+            try_next();
+        }
+        else if (!attempt_timer_armed_) {
+            try_next();
+        }
+    }
+
+    // alternates the address families, starting with the one the last attempt did not use.
+    bool next_endpoint(asio::ip::tcp::endpoint& ep) {
+        auto& preferred = prefer_v6_ ? v6_endpoints_ : v4_endpoints_;
+        auto& other = prefer_v6_ ? v4_endpoints_ : v6_endpoints_;
+        auto& queue = preferred.empty() ? other : preferred;
+
+        if (queue.empty()) {
+            return false;
+        }
+
+        ep = queue.front();
+        queue.pop_front();
+        prefer_v6_ = !ep.address().is_v6();
+        return true;
+    }
+
+    void try_next() {
+        if (done_) {
+            return;
+        }
+
+        asio::ip::tcp::endpoint ep;
+        if (!next_endpoint(ep)) {
+            if (attempts_.empty() && v6_resolved_ && v4_resolved_) {
+                fail();
+            }
+
+            return;
+        }
+
+        auto self = shared_from_this();
+        std::shared_ptr<asio::ip::tcp::socket> attempt = std::make_shared<asio::ip::tcp::socket>(ioc_);
+        attempts_.push_back(attempt);
+
+        attempt->async_connect(ep, [this, self, attempt](const asio::error_code& ec) {
+            on_connected(attempt, ec);
+        });
+
+        // the next attempt starts after the delay, or as soon as this one fails.
+        attempt_timer_armed_ = true;
+        attempt_timer_.expires_after(std::chrono::milliseconds(CONNECTION_ATTEMPT_DELAY_MILLISEC));
+        attempt_timer_.async_wait([this, self](const asio::error_code& ec) {
+            if (ec == asio::error::operation_aborted) {
+                return;
+            }
+
+            attempt_timer_armed_ = false;
+            try_next();
+        });
+    }
+
+    void on_connected(const std::shared_ptr<asio::ip::tcp::socket>& attempt, const asio::error_code& ec) {
+        attempts_.erase(std::remove(attempts_.begin(), attempts_.end(), attempt), attempts_.end());
+
+        if (done_) {
+            return;
+        }
+
+        if (ec) {
+            last_error_ = ec;
+            attempt_timer_armed_ = false;
+            attempt_timer_.cancel();
+            try_next();
+            return;
+        }
+
+        done_ = true;
+        cancel_all();
+        handler_(ec, std::move(*attempt));
+    }
+
+    void fail() {
+        done_ = true;
+        cancel_all();
+
+        asio::ip::tcp::socket none{ ioc_ };
+        handler_(last_error_ ? last_error_ : asio::error::host_not_found, std::move(none));
+    }
+
+    // drops the lookups still in flight, the io_context no longer waits for them.
+    void close_mailbox() {
+        std::lock_guard<std::mutex> lock{ mailbox_->mutex };
+        mailbox_->owner.reset();
+        lookup_work_.reset();
+    }
+
+    void cancel_all() {
+        asio::error_code ec;
+
+        close_mailbox();
+        resolution_timer_.cancel();
+        attempt_timer_.cancel();
+
+        for (const auto& attempt : attempts_) {
+            attempt->close(ec);
+        }
+
+        attempts_.clear();
+    }
+
+    asio::io_context& ioc_;
+    asio::steady_timer resolution_timer_;
+    asio::steady_timer attempt_timer_;
+    asio::executor_work_guard<asio::io_context::executor_type> lookup_work_;
+    const std::string host_;
+    const std::string service_;
+    handler_type handler_;
+    std::shared_ptr<lookup_mailbox> mailbox_;
+
+    std::deque<asio::ip::tcp::endpoint> v6_endpoints_;
+    std::deque<asio::ip::tcp::endpoint> v4_endpoints_;
+    std::vector<std::shared_ptr<asio::ip::tcp::socket>> attempts_;
+    asio::error_code last_error_;
+
+    bool v6_resolved_ = false;
+    bool v4_resolved_ = false;
+    bool started_ = false;
+    bool done_ = false;
+    bool prefer_v6_ = true;
+    bool attempt_timer_armed_ = false;
+};
+
+// connects to host:port with happy eyeballs, blocks until one attempt wins or all fail.
+// a lookup that is still running at that point is left behind on its own thread.
+inline asio::ip::tcp::socket connect_happy_eyeballs(asio::io_context& ioc, const std::string& host, int port, asio::error_code& ec) {
+    asio::ip::tcp::socket result{ ioc };
+
+    std::make_shared<happy_eyeballs_connector>(ioc, host, port,
+        [&result, &ec](const asio::error_code& connect_ec, asio::ip::tcp::socket&& s) {
+            ec = connect_ec;
+            result = std::move(s);
+        })->start();
+
+    ioc.run();
+    ioc.restart();
+    return result;
+}
+
+#endif
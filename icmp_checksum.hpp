@@ -0,0 +1,34 @@
+#ifndef ICMP_CHECKSUM_HPP
+#define ICMP_CHECKSUM_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// rfc 792.
+struct alignas(2) IcmpHeader {
+	uint8_t type;
+	uint8_t code;
+	uint16_t checksum;
+	uint16_t identifier;
+	uint16_t sequence;
+};
+
+inline uint16_t calc_checksum(const uint16_t* data, size_t len) {
+	uint32_t result = 0;
+
+	while (len > 1) {
+		result += *data;
+		++data;
+		len -= 2;
+	}
+
+	if (len > 0) {
+		result += *reinterpret_cast<const uint8_t*>(data);
+	}
+
+	result = (result >> 16) + (result & 0xffff);
+	result += (result >> 16);
+	return static_cast<uint16_t>(~result);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef PARSE_PORT_HPP
+#define PARSE_PORT_HPP
+
+#include <cctype>
+
+// returns the port, or -1 when param is not a decimal number within 0 to 65535.
+inline int parse_port(const char* param) noexcept {
+    int result = 0;
+
+    while (*param) {
+        if (result > 65535) {
+            return -1;
+        }
+
+        if (isdigit(*param)) {
+            result = 10 * result + (*param - '0');
+        }
+        else {
+            return -1;
+        }
+
+        ++param;
+    }
+
+    if (result > 65535) {
+        return -1;
+    }
+
+    return result;
+}
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+// wire layout of the shared memory transport, the echo server and every shm client map the same shm_channel.
+const std::size_t SHM_SLOT_SIZE = 256;
+const std::size_t SHM_SLOT_COUNT = 64;
+
+// the memfd and the two eventfds, the control message buffers are sized for this many descriptors.
+const std::size_t SHM_FD_COUNT = 3;
+
+struct shm_slot {
+    uint32_t len;
+    char data[SHM_SLOT_SIZE];
+};
+
+// single producer single consumer ring living in memory shared by both processes,
+// head and tail sit on their own cache lines so the two sides don't false share.
+struct shm_ring {
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) shm_slot slots[SHM_SLOT_COUNT];
+
+    bool push(const char* data, std::size_t len) noexcept {
+        const uint32_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) >= SHM_SLOT_COUNT || len > SHM_SLOT_SIZE) {
+            return false;
+        }
+
+        shm_slot& slot = slots[t % SHM_SLOT_COUNT];
+        slot.len = (uint32_t)len;
+        std::memcpy(slot.data, data, len);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    const shm_slot* front() const noexcept {
+        const uint32_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+
+        return &slots[h % SHM_SLOT_COUNT];
+    }
+
+    void pop() noexcept {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+};
+
+// requests go from the client to the server, responses the other way.
+struct shm_channel {
+    shm_ring requests;
+    shm_ring responses;
+};
+
+// passes up to SHM_FD_COUNT descriptors over a unix domain socket along with a single byte.
+inline bool send_fds(int sock, const int* fds, std::size_t count) {
+    if (count > SHM_FD_COUNT) {
+        return false;
+    }
+
+    char byte = 0;
+    iovec iov{ &byte, 1 };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(SHM_FD_COUNT * sizeof(int))]{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+
+    return ::sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+}
+
+// receives exactly count descriptors sent by send_fds, at most SHM_FD_COUNT.
+inline bool recv_fds(int sock, int* fds, std::size_t count) {
+    if (count > SHM_FD_COUNT) {
+        return false;
+    }
+
+    char byte = 0;
+    iovec iov{ &byte, 1 };
+
+    alignas(cmsghdr) char control[CMSG_SPACE(SHM_FD_COUNT * sizeof(int))]{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+
+    if (::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC) != 1) {
+        return false;
+    }
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(count * sizeof(int))) {
+        return false;
+    }
+
+    std::memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    return true;
+}
+
+#endif
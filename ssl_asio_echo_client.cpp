@@ -3,31 +3,8 @@
 #include <array>
 #include <asio.hpp>
 #include <asio/ssl.hpp>
-
-int parse_port(const char* param) noexcept {
-    int result = 0;
-
-    while (*param) {
-        if (result > 65535) {
-            return -1;
-        }
-
-        if (isdigit(*param)) {
-            result = 10 * result + (*param - '0');
-        }
-        else {
-            return -1;
-        }
-
-        ++param;
-    }
-
-    if (result > 65535) {
-        return -1;
-    }
-
-    return result;
-}
+#include "parse_port.hpp"
+#include "happy_eyeballs.hpp"
 
 asio::ssl::context create_ssl_context() {
     asio::ssl::context ctx{ asio::ssl::context::tls_client };
@@ -47,32 +24,64 @@ asio::ssl::context create_ssl_context() {
     return ctx;
 }
 
-void echo(const std::string& ip, int port, const std::string& message) {
+void echo(const std::string& host, int port, const std::string& message) {
+    asio::error_code ec;
     asio::io_context ioc{};
 
+    asio::ip::tcp::socket s = connect_happy_eyeballs(ioc, host, port, ec);
+    if (ec) {
+        std::cerr << "connect failed, " << ec.value() << ", " << ec.message() << "\n";
+        return;
+    }
+
     auto sslCtx = create_ssl_context();
-    asio::ssl::stream<asio::ip::tcp::socket> ssl_connection{ ioc, sslCtx };
+    asio::ssl::stream<asio::ip::tcp::socket> ssl_connection{ std::move(s), sslCtx };
 
     auto& raw_socket = ssl_connection.next_layer();
-    asio::ip::tcp::endpoint ep{ asio::ip::make_address(ip), (asio::ip::port_type)port };
-    raw_socket.connect(ep);
 
-    ssl_connection.handshake(asio::ssl::stream_base::client);
-    asio::write(ssl_connection, asio::buffer(message));
+    // sni and host name verification only apply to names, ip literals are not allowed in sni and the
+    // server.crt recipe has no ip san, so for an ip a certificate chaining up to server.crt is enough.
+    asio::error_code address_ec;
+    asio::ip::make_address(host, address_ec);
+    if (address_ec) {
+        if (!SSL_set_tlsext_host_name(ssl_connection.native_handle(), host.c_str())) {
+            std::cerr << "ssl set sni host name failed\n";
+            return;
+        }
+
+        ssl_connection.set_verify_callback(asio::ssl::host_name_verification(host));
+    }
+
+    ssl_connection.handshake(asio::ssl::stream_base::client, ec);
+    if (ec) {
+        std::cerr << "ssl hand shake failed, " << ec.value() << ", " << ec.message() << "\n";
+        return;
+    }
+
+    asio::write(ssl_connection, asio::buffer(message), ec);
+    if (ec) {
+        std::cerr << "write failed, " << ec.value() << ", " << ec.message() << "\n";
+        return;
+    }
 
     std::array<char, 256> buf{};
-    ssl_connection.read_some(asio::buffer(buf));
+    ssl_connection.read_some(asio::buffer(buf), ec);
+    if (ec) {
+        std::cerr << "read failed, " << ec.value() << ", " << ec.message() << "\n";
+        return;
+    }
+
     std::cout << "returned: " << buf.data() << "\n";
 
-    ssl_connection.shutdown();
-    raw_socket.shutdown(asio::ip::tcp::socket::shutdown_both);
-    raw_socket.close();
+    ssl_connection.shutdown(ec);
+    raw_socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+    raw_socket.close(ec);
 }
 
 // g++ asio_echo_client.cpp -I asio/include -I libressl/include -L libressl/tls -L libressl/ssl -L libressl/crypto -l ws2_32 -l tls -l ssl -l crypto -o client
 int main(int argc, char* argv[]) {
     if (argc != 3) {
-        std::cerr << "echo client usage: " << argv[0] << " <ip> <port>\n";
+        std::cerr << "echo client usage: " << argv[0] << " <host> <port>\n";
         return 1;
     }
 
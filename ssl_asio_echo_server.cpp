@@ -1,117 +1,130 @@
 #include <iostream>
 #include <utility>
 #include <array>
+#include <memory>
+#include <string>
+#include <chrono>
 #include <asio.hpp>
 #include <asio/ssl.hpp>
+#include "parse_port.hpp"
+#include "echo_metrics.hpp"
+#include "echo_common.hpp"
+#include "ssl_echo_context.hpp"
+
+class ssl_session : public std::enable_shared_from_this<ssl_session> {
+public:
+    ssl_session(asio::ssl::stream<asio::ip::tcp::socket>&& ssl_connection, buffer_pool& pool, const asio::ip::tcp::endpoint& ep)
+        : ssl_connection_{ std::move(ssl_connection) }, pool_{ pool }, ip_{ ep.address().to_string() }, port_{ ep.port() } {
+        local_metrics().opened.add(1);
+    }
 
-int parse_port(const char* param) noexcept {
-    int result = 0;
+    ~ssl_session() {
+        local_metrics().closed.add(1);
+    }
 
-    while (*param) {
-        if (result > 65535) {
-            return -1;
-        }
+    void start() {
+        auto self = shared_from_this();
+        const auto time_start = std::chrono::steady_clock::now();
 
-        if (isdigit(*param)) {
-            result = 10 * result + (*param - '0');
-        }
-        else {
-            return -1;
-        }
+        ssl_connection_.async_handshake(asio::ssl::stream_base::server, [this, self, time_start](const asio::error_code& ec) {
+            if (ec) {
+                std::cerr << "ssl hand shake failed, " << ec.value() << ", " << ec.message() << "\n";
+                local_metrics().errors.record(ec);
+                return;
+            }
 
-        ++param;
+            local_metrics().handshake_seconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count());
+            read();
+        });
     }
 
-    if (result > 65535) {
-        return -1;
+private:
+    // the read goes straight to the ssl stream, it keeps ciphertext that arrived together with
+    // the handshake or an earlier record in its own buffer, where waiting on the socket won't see it.
+    // the pool buffer is held while the read is pending, it is small next to the stream's own buffers.
+    void read() {
+        auto self = shared_from_this();
+        buf_ = pool_.acquire();
+
+        ssl_connection_.async_read_some(asio::buffer(*buf_), [this, self](const asio::error_code& ec, std::size_t len) {
+            thread_metrics& metrics = local_metrics();
+
+            if (ec) {
+                pool_.release(std::move(buf_));
+
+                // a peer going away is counted by echo_closed_connections_total, only real failures are errors.
+                if (ec == asio::error::eof) {
+                    // the peer has sent its close_notify, answer with ours.
+                    std::cerr << ip_ << ":" << port_ << " connection has been closed\n";
+
+                    asio::error_code shutdown_ec;
+                    ssl_connection_.shutdown(shutdown_ec);
+                }
+                else if (ec == asio::ssl::error::stream_truncated) {
+                    std::cerr << ip_ << ":" << port_ << " connection has been closed\n";
+                }
+                else {
+                    std::cerr << ip_ << ":" << port_ << " read failed, " << ec.value() << ", " << ec.message() << "\n";
+                    metrics.errors.record(ec);
+                }
+
+                close();
+                return;
+            }
+
+            const auto time_start = std::chrono::steady_clock::now();
+            metrics.bytes_in.add(len);
+            metrics.read_bytes.observe((double)len);
+
+            std::cout << ip_ << ":" << port_ << " " << len << ", ";
+            std::cout.write(buf_->data(), len) << "\n";
+
+            send_all(ssl_connection_, *buf_, len, [this, self, time_start](const asio::error_code& ec) {
+                pool_.release(std::move(buf_));
+
+                if (ec) {
+                    close();
+                    return;
+                }
+
+                local_metrics().handler_seconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - time_start).count());
+                read();
+            });
+        });
     }
 
-    return result;
-}
-
-template<std::size_t N>
-void ssl_send_all(asio::ssl::stream<asio::ip::tcp::socket>& connection, const std::array<char, N>& buf, std::size_t len) {
-    asio::error_code ec;
-    std::size_t bytes_written = 0;
-
-    while (bytes_written < len) {
-        std::size_t written = connection.write_some(asio::buffer(buf.data() + bytes_written, len - bytes_written), ec);
-
-        if (ec) {
-            std::cerr << "one ssl connection send failed, " << ec.value() << ", " << ec.message() << "\n";
-            return;
-        }
+    void close() {
+        asio::error_code ec;
+        auto& raw_socket = ssl_connection_.next_layer();
 
-        bytes_written += written;
+        raw_socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
+        raw_socket.close(ec);
     }
-}
 
-void ssl_handle_connection(asio::ssl::stream<asio::ip::tcp::socket>&& ssl_connection) {
+    asio::ssl::stream<asio::ip::tcp::socket> ssl_connection_;
+    buffer_pool& pool_;
+    std::unique_ptr<buffer_pool::buffer> buf_;
+    const std::string ip_;
+    const unsigned short port_;
+};
+
+void ssl_handle_connection(asio::ssl::stream<asio::ip::tcp::socket>&& ssl_connection, buffer_pool& pool) {
     asio::error_code ec;
 
+    local_metrics().accepted.add(1);
+
     auto& raw_socket = ssl_connection.next_layer();
     auto ep = raw_socket.remote_endpoint(ec);
     if (ec) {
         std::cerr << "get remote endpoint failed, " << ec.value() << ", " << ec.message() << "\n";
+        local_metrics().errors.record(ec);
         return;
     }
 
-    const std::string ip = ep.address().to_string();
-    const auto port = ep.port();
-
-    ssl_connection.handshake(asio::ssl::stream_base::server, ec);
-    if (ec) {
-        std::cerr << "ssl hand shake failed, " << ec.value() << ", " << ec.message() << "\n";
-        return;
-    }
-
-    std::array<char, 256> buf;
-    buf.fill('\0');
-
-    std::size_t len = ssl_connection.read_some(asio::buffer(buf), ec);
-
-    if (ec) {
-        if (ec == asio::error::eof) {
-            std::cerr << ip << ":" << port << " connection has been closed\n";
-        }
-        else {
-            std::cerr << ip << ":" << port << " read failed, " << ec.value() << ", " << ec.message() << "\n";
-        }
-
-        return;
-    }
-
-    if (len == 0) {
-        return;
-    }
-
-    std::cout << ip << ":" << port << " " << len << ", " << buf.data() << "\n";
-    ssl_send_all(ssl_connection, buf, len);
-
-    ssl_connection.shutdown();
-    raw_socket.shutdown(asio::ip::tcp::socket::shutdown_both, ec);
-    raw_socket.close();
+    std::make_shared<ssl_session>(std::move(ssl_connection), pool, ep)->start();
 }
 
-asio::ssl::context create_ssl_context() {
-    asio::ssl::context ctx{ asio::ssl::context::tls_server };
-
-    ctx.set_options(
-        asio::ssl::context::default_workarounds |
-        asio::ssl::context::no_sslv2 |
-        asio::ssl::context::no_sslv3 |
-        asio::ssl::context::no_tlsv1 |
-        asio::ssl::context::no_tlsv1_1 |
-        asio::ssl::context::single_dh_use
-    );
-
-    ctx.use_certificate_chain_file("server.crt");
-    ctx.use_private_key_file("server.key", asio::ssl::context::pem);
-
-    return ctx;
-}
-
-void start_echo_server(int port) {
+void start_echo_server(int port, int metrics_port) {
     asio::error_code ec;
     asio::io_context ioc;
     asio::ip::tcp::endpoint ep{ asio::ip::tcp::v4(), (asio::ip::port_type)port };
@@ -119,6 +132,9 @@ void start_echo_server(int port) {
 
     asio::ssl::context sslCtx = create_ssl_context();
 
+    // a handful of cached buffers covers the connections that are echoing at the same moment.
+    buffer_pool pool{ 64 };
+
     acc.open(ep.protocol(), ec);
     if (ec) {
         std::cerr << "acceptor open failed, " << ec.value() << ", " << ec.message() << "\n";
@@ -137,25 +153,29 @@ void start_echo_server(int port) {
         return;
     }
 
-    acc.listen(32, ec);
+    acc.listen(asio::socket_base::max_listen_connections, ec);
     if (ec) {
         std::cerr << "acceptor listen failed, " << ec.value() << ", " << ec.message() << "\n";
         return;
     }
 
-    while (true) {
-        asio::ip::tcp::socket client{ ioc };
-        acc.accept(client, ec);
+    accept_connections(acc, [&sslCtx, &pool](asio::ip::tcp::socket&& client) {
+        asio::ssl::stream<asio::ip::tcp::socket> connection{ std::move(client), sslCtx };
+        ssl_handle_connection(std::move(connection), pool);
+    });
 
-        if (ec) {
-            std::cerr << "acceptor accept failed, " << ec.value() << ", " << ec.message() << "\n";
+    asio::ip::tcp::acceptor metrics_acc{ ioc };
+    if (metrics_port > 0) {
+        if (!open_metrics_acceptor(metrics_acc, metrics_port)) {
             return;
         }
-        else {
-            asio::ssl::stream<asio::ip::tcp::socket> connection{ std::move(client), sslCtx };
-            ssl_handle_connection(std::move(connection));
-        }
+
+        accept_connections(metrics_acc, [](asio::ip::tcp::socket&& client) {
+            std::make_shared<metrics_connection>(std::move(client), true)->start();
+        });
     }
+
+    ioc.run();
 }
 
 /*
@@ -178,9 +198,11 @@ void start_echo_server(int port) {
 // g++ asio_echo_server.cpp -DASIO_STANDALONE -I /root/asio_usage/asio-master/asio/include -I /home/gzy_test/libressl-4.2.1/build/include 
 // -L /home/gzy_test/libressl-4.2.1/build/tls -L /home/gzy_test/libressl-4.2.1/build/ssl -L /home/gzy_test/libressl-4.2.1/build/crypto 
 // -l ssl -l crypto -l tls -lpthread -std=c++11
+//
+// the metrics port is optional, it serves prometheus text on 127.0.0.1 only.
 int main(int argc, char* argv[]) {
-    if (argc != 2) {
-        std::cerr << "echo server usage: " << argv[0] << " <port>\n";
+    if (argc != 2 && argc != 3) {
+        std::cerr << "echo server usage: " << argv[0] << " <port> [metrics port]\n";
         return 1;
     }
 
@@ -190,6 +212,15 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    start_echo_server(port);
+    int metrics_port = 0;
+    if (argc == 3) {
+        metrics_port = parse_port(argv[2]);
+        if (metrics_port <= 0) {
+            std::cerr << "invalid metrics port\n";
+            return 1;
+        }
+    }
+
+    start_echo_server(port, metrics_port);
     return 0;
 }
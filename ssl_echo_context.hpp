@@ -0,0 +1,29 @@
+#ifndef SSL_ECHO_CONTEXT_HPP
+#define SSL_ECHO_CONTEXT_HPP
+
+#include <asio.hpp>
+#include <asio/ssl.hpp>
+
+// the tls echo server's context, server.crt and server.key are loaded from the working directory.
+inline asio::ssl::context create_ssl_context() {
+    asio::ssl::context ctx{ asio::ssl::context::tls_server };
+
+    ctx.set_options(
+        asio::ssl::context::default_workarounds |
+        asio::ssl::context::no_sslv2 |
+        asio::ssl::context::no_sslv3 |
+        asio::ssl::context::no_tlsv1 |
+        asio::ssl::context::no_tlsv1_1 |
+        asio::ssl::context::single_dh_use
+    );
+
+    // let idle connections hand openssl's record buffers back, asio::ssl::stream still keeps its own.
+    ::SSL_CTX_set_mode(ctx.native_handle(), SSL_MODE_RELEASE_BUFFERS);
+
+    ctx.use_certificate_chain_file("server.crt");
+    ctx.use_private_key_file("server.key", asio::ssl::context::pem);
+
+    return ctx;
+}
+
+#endif